@@ -8,6 +8,11 @@ struct Preset {
   byte param2 = 0;
   byte param3 = 0;
   byte program = 0;
+  byte lfoTarget = 0;
+  byte lfoShape = 0;
+  byte lfoRate = 0;
+  byte lfoDepth = 0;
+  byte lfoSync = 0;
 
   void saveTo(byte index);
   void loadFrom(byte index);
@@ -0,0 +1,57 @@
+#include "Autosave.h"
+#include <IoAbstraction.h>
+#include "ApplicationModel.h"
+#include "Io.h"
+#include "MidiInput.h"
+#include "ProgramSwitch.h"
+
+bool autosaveEnabled = DEFAULT_AUTOSAVE_ENABLED;
+unsigned long autosaveIdleTime = DEFAULT_AUTOSAVE_IDLE_TIME;
+
+bool presetDirty = false;
+Preset savedPreset;
+unsigned long lastActivityTime = 0;
+
+void markPresetDirty() {
+  presetDirty = true;
+  lastActivityTime = millis();
+}
+
+void markPresetClean() {
+  presetDirty = false;
+  savedPreset = currentPreset;
+}
+
+void noteUserActivity() {
+  lastActivityTime = millis();
+}
+
+bool hasUnsavedEdits() {
+  return autosaveEnabled && presetDirty;
+}
+
+void flushAutosave(Preset preset, byte index) {
+  if (hasUnsavedEdits()) {
+    writePresetChanges(preset, savedPreset, index);
+    presetDirty = false;
+    savedPreset = preset;
+  }
+}
+
+void checkAutosave() {
+  if (!autosaveEnabled || !presetDirty) {
+    return;
+  }
+  if (millis() - lastActivityTime < autosaveIdleTime) {
+    return;
+  }
+  // incoming midi, a running program switch and earlier writes go first, try again on the next check
+  if (midiInput.available() > 0 || isSwitchingProgram() || isWritingMemory()) {
+    return;
+  }
+  flushAutosave(currentPreset, currentPresetNumber);
+}
+
+void setupAutosave() {
+  taskManager.scheduleFixedRate(AUTOSAVE_CHECK_INTERVAL, checkAutosave);
+}
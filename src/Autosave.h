@@ -0,0 +1,28 @@
+#ifndef AUTOSAVE_H
+#define AUTOSAVE_H
+
+#include <Arduino.h>
+#include "ApplicationModel.h"
+
+#define DEFAULT_AUTOSAVE_ENABLED false
+#define DEFAULT_AUTOSAVE_IDLE_TIME 5000
+#define AUTOSAVE_CHECK_INTERVAL 100
+
+extern bool autosaveEnabled;
+// Time in ms without user activity before an edited preset gets saved.
+extern unsigned long autosaveIdleTime;
+
+// Schedules the background check on the task manager.
+void setupAutosave();
+
+void markPresetDirty();
+// Takes currentPreset as the stored copy, call it after loading or saving.
+void markPresetClean();
+void noteUserActivity();
+bool hasUnsavedEdits();
+
+// Saves an edited preset right away, e.g. when another preset gets opened.
+// Only the changed bytes are queued, nothing is read back.
+void flushAutosave(Preset preset, byte index);
+
+#endif
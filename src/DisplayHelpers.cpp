@@ -2,6 +2,7 @@
 
 #include <Adafruit_LEDBackpack.h>
 #include <Adafruit_GFX.h>
+#include "I2cBus.h"
 
 // LETTERS 
 #define LED_S 0b01101101
@@ -21,6 +22,17 @@ Adafruit_7segment matrix = Adafruit_7segment();
 
 int dotIndex = 0;
 
+// ---- Bus
+bool flushDisplay() {
+  matrix.writeDisplay();
+  return true;
+}
+
+// Consecutive draws between two bus passes end up in one write.
+void requestDisplayUpdate() {
+  queueI2cJob(IP_DISPLAY, flushDisplay);
+}
+
 // ---- LED Helpers 
 void drawByteOnTwoDigits(byte value, byte startIndex) {
   if (value > 9)  {
@@ -35,7 +47,7 @@ void drawTwoBytes(byte value1, byte value2) {
    drawByteOnTwoDigits(value1, FIRST_DIGIT_INDEX);
    drawByteOnTwoDigits(value2, THIRD_DIGIT_INDEX);
    matrix.drawColon(true);
-   matrix.writeDisplay();
+   requestDisplayUpdate();
 }
 
 int drawDigit(int value, int base, byte index, bool clearDigit) {
@@ -63,7 +75,7 @@ void drawNumber(int value) {
   newValue = drawDigit(newValue, 10, THIRD_DIGIT_INDEX, value < 10);
   
   matrix.writeDigitNum(FOURTH_DIGIT_INDEX, newValue % 10);  
-  matrix.writeDisplay();
+  requestDisplayUpdate();
 }
 
 void startBlink() {
@@ -75,7 +87,7 @@ void stopBlink() {
 }
 
 void setupDisplay() {
-  matrix.begin(0x70);
+  matrix.begin(DISPLAY_I2C_ADDRESS);
 }
 
 void showDone() {
@@ -83,10 +95,11 @@ void showDone() {
   matrix.writeDigitRaw(SECOND_DIGIT_INDEX, LED_O);    
   matrix.writeDigitRaw(THIRD_DIGIT_INDEX, LED_N);    
   matrix.writeDigitRaw(FOURTH_DIGIT_INDEX, LED_E);  
-  matrix.writeDisplay();  
+  // written right away, callers hold it on screen with a delay
+  flushDisplay();
 }
 
 void hideColon() {
   matrix.drawColon(false);
-  matrix.writeDisplay();
+  requestDisplayUpdate();
 }
\ No newline at end of file
@@ -0,0 +1,60 @@
+#include "EditHistory.h"
+
+EditRecord history[HISTORY_LENGTH];
+byte historyCount = 0;
+// Records below the cursor are applied, the ones above can be redone.
+byte historyCursor = 0;
+
+void recordEdit(byte field, byte index, byte oldValue, byte newValue) {
+  // a new edit drops whatever could have been redone
+  historyCount = historyCursor;
+
+  if (historyCount > 0) {
+    EditRecord &last = history[historyCount - 1];
+    if (last.field == field && last.index == index) {
+      last.newValue = newValue;
+      if (last.oldValue == last.newValue) {
+        // turned back to where it started, nothing left to undo
+        historyCount--;
+        historyCursor--;
+      }
+      return;
+    }
+  }
+
+  if (historyCount == HISTORY_LENGTH) {
+    memmove(history, history + 1, (HISTORY_LENGTH - 1) * sizeof(EditRecord));
+    historyCount--;
+  }
+
+  EditRecord &record = history[historyCount];
+  record.field = field;
+  record.index = index;
+  record.oldValue = oldValue;
+  record.newValue = newValue;
+  historyCount++;
+  historyCursor = historyCount;
+}
+
+bool undoEdit(EditRecord &record) {
+  if (historyCursor == 0) {
+    return false;
+  }
+  historyCursor--;
+  record = history[historyCursor];
+  return true;
+}
+
+bool redoEdit(EditRecord &record) {
+  if (historyCursor == historyCount) {
+    return false;
+  }
+  record = history[historyCursor];
+  historyCursor++;
+  return true;
+}
+
+void clearEditHistory() {
+  historyCount = 0;
+  historyCursor = 0;
+}
@@ -0,0 +1,34 @@
+#ifndef EDIT_HISTORY_H
+#define EDIT_HISTORY_H
+
+#include <Arduino.h>
+
+#define HISTORY_LENGTH 16
+
+enum EditField {
+  EF_PARAM1,
+  EF_PARAM2,
+  EF_PARAM3,
+  EF_PROGRAM,
+  EF_MIDI_MAP
+};
+
+// index is only used by the midi map, it holds the mapping index.
+struct EditRecord {
+  byte field;
+  byte index;
+  byte oldValue;
+  byte newValue;
+};
+
+// Consecutive edits of the same field are merged into one record.
+void recordEdit(byte field, byte index, byte oldValue, byte newValue);
+
+// Return false if there is nothing to undo or redo.
+// The caller applies oldValue of an undone and newValue of a redone record.
+bool undoEdit(EditRecord &record);
+bool redoEdit(EditRecord &record);
+
+void clearEditHistory();
+
+#endif
@@ -0,0 +1,86 @@
+#include "I2cBus.h"
+#include <Wire.h>
+
+struct QueuedJob {
+  I2cJob job;
+  byte priority;
+  unsigned long queuedAt;
+};
+
+QueuedJob i2cQueue[I2C_QUEUE_LENGTH];
+I2cStats i2cStats;
+
+void setupI2c() {
+  Wire.begin();
+  useFastI2c(false);
+}
+
+void useFastI2c(bool fast) {
+  Wire.setClock(fast ? I2C_FAST_CLOCK : I2C_STANDARD_CLOCK);
+}
+
+bool isI2cDeviceReady(byte address) {
+  Wire.beginTransmission(address);
+  return Wire.endTransmission() == 0;
+}
+
+void queueI2cJob(I2cPriority priority, I2cJob job) {
+  for (byte i = 0; i < i2cStats.depth; i++) {
+    if (i2cQueue[i].job == job) {
+      i2cStats.merged++;
+      return;
+    }
+  }
+
+  if (i2cStats.depth == I2C_QUEUE_LENGTH) {
+    // blocks this once, but the job is not lost
+    i2cStats.overflows++;
+    useFastI2c(true);
+    while (!job());
+    useFastI2c(false);
+    return;
+  }
+
+  // keep the queue ordered by priority, fifo within one priority
+  byte index = i2cStats.depth;
+  while (index > 0 && i2cQueue[index - 1].priority > priority) {
+    i2cQueue[index] = i2cQueue[index - 1];
+    index--;
+  }
+  i2cQueue[index].job = job;
+  i2cQueue[index].priority = priority;
+  i2cQueue[index].queuedAt = millis();
+
+  i2cStats.depth++;
+  if (i2cStats.depth > i2cStats.maxDepth) {
+    i2cStats.maxDepth = i2cStats.depth;
+  }
+}
+
+void removeJob(byte index) {
+  unsigned long waitTime = millis() - i2cQueue[index].queuedAt;
+  i2cStats.totalWaitTime += waitTime;
+  if (waitTime > i2cStats.maxWaitTime) {
+    i2cStats.maxWaitTime = waitTime;
+  }
+  i2cStats.completed++;
+
+  i2cStats.depth--;
+  for (byte i = index; i < i2cStats.depth; i++) {
+    i2cQueue[i] = i2cQueue[i + 1];
+  }
+}
+
+void serviceI2c() {
+  if (i2cStats.depth == 0) {
+    return;
+  }
+
+  useFastI2c(true);
+  bool done = i2cQueue[0].job();
+  useFastI2c(false);
+
+  if (done) {
+    removeJob(0);
+  }
+}
@@ -0,0 +1,53 @@
+#ifndef I2C_BUS_H
+#define I2C_BUS_H
+
+#include <Arduino.h>
+
+#define ENCODER_I2C_ADDRESS 0x20
+#define EEPROM_I2C_ADDRESS 0x50
+#define DISPLAY_I2C_ADDRESS 0x70
+
+// The PCF8574 only supports standard mode, display and eeprom run in fast mode.
+#define I2C_STANDARD_CLOCK 100000
+#define I2C_FAST_CLOCK 400000
+
+#define I2C_QUEUE_LENGTH 6
+
+// Lower value runs first. Encoder reads are not queued, they run in the task
+// manager, which loop() services before the queue.
+enum I2cPriority {
+  IP_STORAGE = 0,
+  IP_DISPLAY = 1
+};
+
+// Runs one bus transaction, an address probe of a busy device counts as one.
+// Returns false if the job has to run again on a later pass, true once it is done.
+typedef bool (*I2cJob)();
+
+struct I2cStats {
+  byte depth;
+  byte maxDepth;
+  unsigned int completed;
+  unsigned int merged;
+  unsigned int overflows;
+  unsigned long maxWaitTime;
+  unsigned long totalWaitTime;
+};
+
+extern I2cStats i2cStats;
+
+void setupI2c();
+
+// Queues a job in fast mode. A job that is already queued is merged.
+// If the queue is full the job runs right away instead.
+void queueI2cJob(I2cPriority priority, I2cJob job);
+
+// Runs the most urgent job, one bus transaction per call.
+void serviceI2c();
+
+void useFastI2c(bool fast);
+
+// Address probe, an eeprom does not acknowledge while it is writing.
+bool isI2cDeviceReady(byte address);
+
+#endif
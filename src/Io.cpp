@@ -1,125 +1,587 @@
 #include "Io.h"
+#include <util/crc16.h>
+#include <Wire.h>
 #include <EepromAbstraction.h>
 #include <EepromAbstractionWire.h>
+#include "I2cBus.h"
 
 #define EMULATE_EEPROM // for development I use ram. That way the eeprom wont ware off.
 
+#define CHUNK_LENGTH 16
+#define MEMORY_SIZE (HEADER_LENGTH + RECORD_LENGTH * PRESET_COUNT + PRESET_COUNT)
+
+// Migration journal, behind everything any layout version uses. Not kept in
+// emulation, the ram comes up empty on every reset and never holds an old layout.
+// [0] version being migrated from, 0 if none
+// [1] last used preset index and [2] damaged sections of the old memory
+// [3] number of finished steps
+// [4..] step, length, data and crc of the step in progress
+#define JOURNAL_OFFSET MEMORY_SIZE
+#define JOURNAL_MARKER 0
+#define JOURNAL_STATE 1
+#define JOURNAL_DAMAGED 2
+#define JOURNAL_COMMITTED 3
+#define JOURNAL_ENTRY 4
+#define JOURNAL_ENTRY_LENGTH (2 + CHUNK_LENGTH + 2)
+#define JOURNAL_LENGTH (JOURNAL_ENTRY + JOURNAL_ENTRY_LENGTH)
+
 #ifdef EMULATE_EEPROM
-byte memory[200];
+byte memory[MEMORY_SIZE];
 #endif
 
-I2cAt24Eeprom eeprom(0x50, 32);
+#define VERSION_OFFSET 3
+#define LAYOUT_INFO_LENGTH 7
+#define HEADER_CRC_OFFSET 7
+#define MAP_CRC_OFFSET 9
+#define STATE_CRC_OFFSET 11
+#define STATE_OFFSET 13
+#define LEGACY_SECTION_CRC_OFFSET 9
 
-bool isMemoryInitialized() {
+#define MAP_MIGRATION_STEPS (PRESET_COUNT / CHUNK_LENGTH)
+#define MIGRATION_STEPS (MAP_MIGRATION_STEPS + PRESET_COUNT)
+
+#define DAMAGED_PRESETS _BV(0)
+#define DAMAGED_MIDI_MAP _BV(1)
+#define DAMAGED_STATE _BV(2)
+
+#define EEPROM_PAGE_SIZE 32
+#define PENDING_WRITE_LENGTH 16
+#define PENDING_WRITE_COUNT 4
+
+I2cAt24Eeprom eeprom(EEPROM_I2C_ADDRESS, EEPROM_PAGE_SIZE);
+
+struct Layout {
+  byte version;
+  byte headerLength;
+  byte presetLength;
+  byte recordLength;
+
+  int recordOffset(byte index) { return headerLength + index * recordLength; }
+  int mapOffset() { return recordOffset(PRESET_COUNT); }
+  int stateOffset() { return version >= 4 ? STATE_OFFSET : mapOffset() + PRESET_COUNT; }
+};
+
+Layout currentLayout = {LAYOUT_VERSION, HEADER_LENGTH, PRESET_LENGTH, RECORD_LENGTH};
+
+#ifndef EMULATE_EEPROM
+// Version 1 to 3, none of them had a crc per record.
+const Layout legacyLayouts[] = {
+  {1, SIGNATURE_LENGTH, 4, 4},
+  {2, HEADER_LENGTH, 4, 4},
+  {3, HEADER_LENGTH, 9, 9}
+};
+#endif
+
+// ---- Write behind
+// Writes are queued on the bus. Instead of waiting out the write cycle of the
+// eeprom, the next chunk is sent on a later pass once the eeprom acknowledges.
+#ifndef EMULATE_EEPROM
+struct PendingWrite {
+  int offset;
+  byte length;
+  byte data[PENDING_WRITE_LENGTH];
+};
+
+PendingWrite pendingWrites[PENDING_WRITE_COUNT];
+byte pendingWriteHead = 0;
+byte pendingWriteCount = 0;
+
+bool writePendingChunk() {
+  if (pendingWriteCount == 0) {
+    return true;
+  }
+
+  // the write doubles as the ack poll, a busy eeprom does not acknowledge its address
+  PendingWrite &pending = pendingWrites[pendingWriteHead];
+  Wire.beginTransmission(EEPROM_I2C_ADDRESS);
+  Wire.write((byte)(pending.offset >> 8));
+  Wire.write((byte)pending.offset);
+  Wire.write(pending.data, pending.length);
+  if (Wire.endTransmission() != 0) {
+    return false;
+  }
+
+  pendingWriteHead = (pendingWriteHead + 1) % PENDING_WRITE_COUNT;
+  pendingWriteCount--;
+  return pendingWriteCount == 0;
+}
+
+// Only blocks if a read or a full buffer comes right after a write.
+void waitForPendingWrites() {
+  useFastI2c(true);
+  while (!writePendingChunk() || !isI2cDeviceReady(EEPROM_I2C_ADDRESS));
+  useFastI2c(false);
+}
+
+void queueWrite(int offset, const byte *src, byte length) {
+  while (length > 0) {
+    // a chunk must not wrap around an eeprom page
+    byte chunkLength = min(length, PENDING_WRITE_LENGTH);
+    chunkLength = min(chunkLength, EEPROM_PAGE_SIZE - offset % EEPROM_PAGE_SIZE);
+
+    if (pendingWriteCount == PENDING_WRITE_COUNT) {
+      waitForPendingWrites();
+    }
+
+    PendingWrite &pending = pendingWrites[(pendingWriteHead + pendingWriteCount) % PENDING_WRITE_COUNT];
+    pending.offset = offset;
+    pending.length = chunkLength;
+    memcpy(pending.data, src, chunkLength);
+    pendingWriteCount++;
+
+    offset += chunkLength;
+    src += chunkLength;
+    length -= chunkLength;
+  }
+  queueI2cJob(IP_STORAGE, writePendingChunk);
+}
+#endif
+
+bool isWritingMemory() {
   #ifdef EMULATE_EEPROM
-  return memory[0] == 'M' && memory[1] == 'F' && memory[2] == 'X';
+  return false;
   #else
-  return eeprom.read8(0) == 'M' && eeprom.read8(1) == 'F' && eeprom.read8(2) == 'X';
+  return pendingWriteCount > 0;
   #endif
 }
 
-void factoryReset() {
+// ---- Raw access
+void readBytes(int offset, byte *dest, byte length) {
   #ifdef EMULATE_EEPROM
-  // write signature
-  memory[0] = 'M';
-  memory[1] = 'F';  
-  memory[2] = 'X';
+  memcpy(dest, memory + offset, length);
   #else
-  eeprom.write8(0, 'M');
-  eeprom.write8(1, 'F');
-  eeprom.write8(2, 'X');
+  waitForPendingWrites();
+  useFastI2c(true);
+  eeprom.readIntoMemArray(dest, offset, length);
+  useFastI2c(false);
   #endif
-    
-  Preset emptyPreset;
-  
-  for (int i = 0; i < PRESET_COUNT; i++) {
-    writePresetData(emptyPreset, i);
+}
+
+void writeBytes(int offset, const byte *src, byte length) {
+  #ifdef EMULATE_EEPROM
+  memcpy(memory + offset, src, length);
+  #else
+  queueWrite(offset, src, length);
+  #endif
+}
+
+byte readByte(int offset) {
+  byte value;
+  readBytes(offset, &value, 1);
+  return value;
+}
+
+void writeByte(int offset, byte value) {
+  writeBytes(offset, &value, 1);
+}
+
+// ---- Checksums
+uint16_t crcOfBuffer(uint16_t crc, const byte *data, byte length) {
+  for (byte i = 0; i < length; i++) {
+    crc = _crc16_update(crc, data[i]);
   }
+  return crc;
+}
 
-  // reset midi map
+uint16_t crcOf(const byte *data, byte length) {
+  return crcOfBuffer(0xFFFF, data, length);
+}
+
+uint16_t crcOfRange(int offset, int length) {
+  byte chunk[CHUNK_LENGTH];
+  uint16_t crc = 0xFFFF;
+  while (length > 0) {
+    byte chunkLength = min(length, CHUNK_LENGTH);
+    readBytes(offset, chunk, chunkLength);
+    crc = crcOfBuffer(crc, chunk, chunkLength);
+    offset += chunkLength;
+    length -= chunkLength;
+  }
+  return crc;
+}
+
+void putWord(byte *dest, uint16_t value) {
+  dest[0] = value >> 8;
+  dest[1] = value;
+}
+
+uint16_t getWord(const byte *src) {
+  return (src[0] << 8) | src[1];
+}
+
+// ---- Records
+void presetToRecord(Preset &preset, byte *record) {
+  record[0] = preset.program;
+  record[1] = preset.param1;
+  record[2] = preset.param2;
+  record[3] = preset.param3;
+  record[4] = preset.lfoTarget;
+  record[5] = preset.lfoShape;
+  record[6] = preset.lfoRate;
+  record[7] = preset.lfoDepth;
+  record[8] = preset.lfoSync;
+  putWord(record + PRESET_LENGTH, crcOf(record, PRESET_LENGTH));
+}
+
+void recordToPreset(const byte *record, Preset &preset) {
+  preset.program = record[0];
+  preset.param1 = record[1];
+  preset.param2 = record[2];
+  preset.param3 = record[3];
+  preset.lfoTarget = record[4];
+  preset.lfoShape = record[5];
+  preset.lfoRate = record[6];
+  preset.lfoDepth = record[7];
+  preset.lfoSync = record[8];
+}
+
+bool isRecordValid(const byte *record) {
+  return getWord(record + PRESET_LENGTH) == crcOf(record, PRESET_LENGTH);
+}
+
+// Writes everything from the first changed byte up to the crc. On the eeprom this
+// may go out in several chunks. A torn write still only damages this one record,
+// because its crc no longer matches and the check on the next boot repairs it.
+bool writeRecordChanges(byte index, const byte *record, const byte *stored) {
+  byte first = 0;
+  while (first < PRESET_LENGTH && record[first] == stored[first]) {
+    first++;
+  }
+  if (first == PRESET_LENGTH) {
+    return false;
+  }
+  writeBytes(currentLayout.recordOffset(index) + first, record + first, RECORD_LENGTH - first);
+  return true;
+}
+
+void writeDefaultPreset(byte index) {
+  Preset emptyPreset;
+  byte record[RECORD_LENGTH];
+  presetToRecord(emptyPreset, record);
+  writeBytes(currentLayout.recordOffset(index), record, RECORD_LENGTH);
+}
+
+void writeDefaultMidiMap() {
   for (int i = 0; i < PRESET_COUNT; i++) {
     midiMap[i] = i;
   }
-
   writeMidiMapping();
 }
 
-void writePresetData(Preset preset, byte index) {
-  int offset = SIGNATURE_LENGTH + index * PRESET_LENGTH;
+// ---- Header
+bool hasSignature(const byte *header) {
+  return header[0] == 'M' && header[1] == 'F' && header[2] == 'X';
+}
 
-  #ifdef EMULATE_EEPROM
-  memory[offset] = preset.program;
-  memory[offset + 1] = preset.param1;
-  memory[offset + 2] = preset.param2;
-  memory[offset + 3] = preset.param3;
-  #else 
-  eeprom.write8(offset, preset.program);
-  eeprom.write8(offset + 1, preset.param1);
-  eeprom.write8(offset + 2, preset.param2);
-  eeprom.write8(offset + 3, preset.param3);
-  #endif
+bool showsLayout(const byte *header, const Layout &layout) {
+  return header[VERSION_OFFSET] == layout.version
+    && header[4] == layout.presetLength
+    && header[5] == PRESET_COUNT
+    && header[6] == PRESET_COUNT;
 }
 
-void writeMidiMapping() {
-  int offset = SIGNATURE_LENGTH + PRESET_LENGTH * PRESET_COUNT;
-  // write midi map
-  for (int i = 0; i < PRESET_COUNT; i++) {
-    #ifdef EMULATE_EEPROM
-    memory[offset] = midiMap[i];
-    #else
-    eeprom.write8(offset, midiMap[i]);
-    #endif
-    offset++;
+bool hasValidHeaderCrc(const byte *header) {
+  return getWord(header + HEADER_CRC_OFFSET) == crcOf(header, LAYOUT_INFO_LENGTH);
+}
+
+void writeHeader() {
+  byte header[LAYOUT_INFO_LENGTH + 2] = {
+    'M', 'F', 'X',
+    currentLayout.version,
+    currentLayout.presetLength,
+    PRESET_COUNT,
+    PRESET_COUNT
+  };
+  putWord(header + HEADER_CRC_OFFSET, crcOf(header, LAYOUT_INFO_LENGTH));
+  writeBytes(0, header, LAYOUT_INFO_LENGTH + 2);
+}
+
+// Checks every record and section of a current memory and rewrites only the damaged ones.
+bool repairDamagedSections(const byte *header) {
+  bool repaired = false;
+
+  byte record[RECORD_LENGTH];
+  for (byte i = 0; i < PRESET_COUNT; i++) {
+    readBytes(currentLayout.recordOffset(i), record, RECORD_LENGTH);
+    if (!isRecordValid(record)) {
+      writeDefaultPreset(i);
+      repaired = true;
+    }
+  }
+
+  readMidiMap();
+  if (getWord(header + MAP_CRC_OFFSET) != crcOf(midiMap, PRESET_COUNT)) {
+    writeDefaultMidiMap();
+    repaired = true;
+  }
+
+  if (getWord(header + STATE_CRC_OFFSET) != crcOf(header + STATE_OFFSET, STATE_LENGTH)) {
+    writeLastUsedPresetIndex(0);
+    repaired = true;
+  }
+
+  return repaired;
+}
+
+#ifndef EMULATE_EEPROM
+// ---- Migration
+// Runs in steps, back to front, so a record only ever moves to a higher offset
+// over data that was already moved. Every step goes through the journal first,
+// which lets an interrupted migration pick up where it stopped.
+bool layoutForVersion(byte version, Layout &layout) {
+  if (version < 1 || version >= LAYOUT_VERSION) {
+    return false;
   }
+  layout = legacyLayouts[version - 1];
+  return true;
 }
 
-void readPresetData(byte index) {
-  int offset = SIGNATURE_LENGTH + index * PRESET_LENGTH;
+byte legacyDamagedSections(Layout &layout, const byte *header) {
+  int lengths[3] = {layout.presetLength * PRESET_COUNT, PRESET_COUNT, STATE_LENGTH};
+  int offsets[3] = {layout.recordOffset(0), layout.mapOffset(), layout.stateOffset()};
+
+  byte damaged = 0;
+  for (byte section = 0; section < 3; section++) {
+    uint16_t storedCrc = getWord(header + LEGACY_SECTION_CRC_OFFSET + section * 2);
+    if (crcOfRange(offsets[section], lengths[section]) != storedCrc) {
+      damaged |= _BV(section);
+    }
+  }
+  return damaged;
+}
+
+int migrationTarget(byte step) {
+  if (step < MAP_MIGRATION_STEPS) {
+    return currentLayout.mapOffset() + (MAP_MIGRATION_STEPS - 1 - step) * CHUNK_LENGTH;
+  }
+  return currentLayout.recordOffset(PRESET_COUNT - 1 - (step - MAP_MIGRATION_STEPS));
+}
+
+// Reads the source of a step and returns it in the new format.
+byte readMigrationStep(Layout &from, byte step, byte *data) {
+  if (step < MAP_MIGRATION_STEPS) {
+    readBytes(from.mapOffset() + (MAP_MIGRATION_STEPS - 1 - step) * CHUNK_LENGTH, data, CHUNK_LENGTH);
+    return CHUNK_LENGTH;
+  }
+
+  // Fields added since the old layout are zero, which matches the Preset defaults.
+  byte index = PRESET_COUNT - 1 - (step - MAP_MIGRATION_STEPS);
+  memset(data, 0, PRESET_LENGTH);
+  readBytes(from.recordOffset(index), data, from.presetLength);
+  putWord(data + PRESET_LENGTH, crcOf(data, PRESET_LENGTH));
+  return RECORD_LENGTH;
+}
+
+void writeJournalEntry(byte step, const byte *data, byte length) {
+  byte entry[JOURNAL_ENTRY_LENGTH];
+  memset(entry, 0, JOURNAL_ENTRY_LENGTH);
+  entry[0] = step;
+  entry[1] = length;
+  memcpy(entry + 2, data, length);
+  putWord(entry + 2 + CHUNK_LENGTH, crcOf(entry, 2 + CHUNK_LENGTH));
+  writeBytes(JOURNAL_OFFSET + JOURNAL_ENTRY, entry, JOURNAL_ENTRY_LENGTH);
+}
+
+bool readJournalEntry(byte &step, byte *data, byte &length) {
+  byte entry[JOURNAL_ENTRY_LENGTH];
+  readBytes(JOURNAL_OFFSET + JOURNAL_ENTRY, entry, JOURNAL_ENTRY_LENGTH);
+  if (getWord(entry + 2 + CHUNK_LENGTH) != crcOf(entry, 2 + CHUNK_LENGTH) || entry[1] > CHUNK_LENGTH) {
+    return false;
+  }
+  step = entry[0];
+  length = entry[1];
+  memcpy(data, entry + 2, length);
+  return true;
+}
+
+void finishMigration() {
+  byte damaged = readByte(JOURNAL_OFFSET + JOURNAL_DAMAGED);
+  byte state = readByte(JOURNAL_OFFSET + JOURNAL_STATE);
+
+  if (damaged & DAMAGED_PRESETS) {
+    // the old memory had one crc for all presets, there is no telling which one broke
+    for (byte i = 0; i < PRESET_COUNT; i++) {
+      writeDefaultPreset(i);
+    }
+  }
+  if (damaged & DAMAGED_MIDI_MAP) {
+    writeDefaultMidiMap();
+  } else {
+    readMidiMap();
+    writeMidiMapping();
+  }
+  writeLastUsedPresetIndex((damaged & DAMAGED_STATE) || state >= PRESET_COUNT ? 0 : state);
+
+  writeHeader();
+  writeByte(JOURNAL_OFFSET + JOURNAL_MARKER, 0);
+}
+
+void runMigration(Layout &from, byte step) {
+  byte data[CHUNK_LENGTH];
+  for (; step < MIGRATION_STEPS; step++) {
+    byte length = readMigrationStep(from, step, data);
+    writeJournalEntry(step, data, length);
+    writeBytes(migrationTarget(step), data, length);
+    writeByte(JOURNAL_OFFSET + JOURNAL_COMMITTED, step + 1);
+  }
+  finishMigration();
+}
+
+void startMigration(Layout &from, byte damaged) {
+  // the old state byte lies where the new records go, keep it in the journal
+  writeByte(JOURNAL_OFFSET + JOURNAL_STATE, readByte(from.stateOffset()));
+  writeByte(JOURNAL_OFFSET + JOURNAL_DAMAGED, damaged);
+  writeByte(JOURNAL_OFFSET + JOURNAL_COMMITTED, 0);
+  writeByte(JOURNAL_OFFSET + JOURNAL_ENTRY, 0xFF);
+  writeByte(JOURNAL_OFFSET + JOURNAL_MARKER, from.version);
+  runMigration(from, 0);
+}
+
+void resumeMigration(Layout &from) {
+  byte step = readByte(JOURNAL_OFFSET + JOURNAL_COMMITTED);
+  byte data[CHUNK_LENGTH];
+  byte journalStep;
+  byte length;
+
+  // The target of this step may be half written and its source already overwritten,
+  // the journal holds a complete copy. Without a valid entry the step never started.
+  if (readJournalEntry(journalStep, data, length) && journalStep == step) {
+    writeBytes(migrationTarget(step), data, length);
+    step++;
+    writeByte(JOURNAL_OFFSET + JOURNAL_COMMITTED, step);
+  }
+  runMigration(from, step);
+}
+#endif
+
+// ---- Public
+bool isMemoryInitialized() {
+  byte header[LAYOUT_INFO_LENGTH + 2];
+  readBytes(0, header, LAYOUT_INFO_LENGTH + 2);
+  return hasSignature(header) && showsLayout(header, currentLayout) && hasValidHeaderCrc(header);
+}
+
+MemoryCheckResult checkMemory() {
+  // one burst for the whole header, the records are checked one by one
+  byte header[HEADER_LENGTH];
+  readBytes(0, header, HEADER_LENGTH);
+
+  if (!hasSignature(header)) {
+    factoryReset();
+    return MC_FACTORY_RESET;
+  }
+
+  bool showsCurrentLayout = showsLayout(header, currentLayout);
+  bool headerValid = showsCurrentLayout && hasValidHeaderCrc(header);
+
+  #ifndef EMULATE_EEPROM
+  byte marker = readByte(JOURNAL_OFFSET + JOURNAL_MARKER);
+  Layout from;
+
+  // The header is written last, so an unfinished migration never shows a valid one.
+  if (!headerValid && layoutForVersion(marker, from)) {
+    resumeMigration(from);
+    return MC_MIGRATED;
+  }
+  if (marker != 0) {
+    // finished, only clearing the marker got lost
+    writeByte(JOURNAL_OFFSET + JOURNAL_MARKER, 0);
+  }
+  #endif
+
+  if (headerValid) {
+    return repairDamagedSections(header) ? MC_REPAIRED : MC_OK;
+  }
+
+  if (showsCurrentLayout) {
+    // only the header crc broke, migrating would treat current data as version 1
+    writeHeader();
+    repairDamagedSections(header);
+    return MC_REPAIRED;
+  }
 
   #ifdef EMULATE_EEPROM
-  currentPreset.program = memory[offset];
-  currentPreset.param1 = memory[offset + 1];
-  currentPreset.param2 = memory[offset + 2];
-  currentPreset.param3 = memory[offset + 3];
+  factoryReset();
+  return MC_FACTORY_RESET;
   #else
-  currentPreset.program = eeprom.read8(offset);
-  currentPreset.param1 = eeprom.read8(offset + 1);
-  currentPreset.param2 = eeprom.read8(offset + 2);
-  currentPreset.param3 = eeprom.read8(offset + 3);
+  // A version 1 memory has preset data where the header crc would be.
+  byte damaged = 0;
+  if (hasValidHeaderCrc(header)) {
+    if (!layoutForVersion(header[VERSION_OFFSET], from) || from.version == 1 || !showsLayout(header, from)) {
+      factoryReset();
+      return MC_FACTORY_RESET;
+    }
+    damaged = legacyDamagedSections(from, header);
+  } else {
+    from = legacyLayouts[0];
+  }
+
+  startMigration(from, damaged);
+  return MC_MIGRATED;
   #endif
 }
 
-void readMidiMap() {
-  int offset = SIGNATURE_LENGTH + PRESET_LENGTH * PRESET_COUNT;
-  // read midi map
-  for (int i = 0; i < PRESET_COUNT; i++) {
-    #ifdef EMULATE_EEPROM
-    midiMap[i] = memory[offset];
-    #else
-    midiMap[i] = eeprom.read8(offset);
-    #endif
-    offset++;
+void factoryReset() {
+  for (byte i = 0; i < PRESET_COUNT; i++) {
+    writeDefaultPreset(i);
+  }
+  writeDefaultMidiMap();
+  writeLastUsedPresetIndex(0);
+  writeHeader();
+  #ifndef EMULATE_EEPROM
+  writeByte(JOURNAL_OFFSET + JOURNAL_MARKER, 0);
+  #endif
+}
+
+bool writePresetData(Preset preset, byte index) {
+  byte record[RECORD_LENGTH];
+  byte stored[RECORD_LENGTH];
+  presetToRecord(preset, record);
+  readBytes(currentLayout.recordOffset(index), stored, RECORD_LENGTH);
+
+  if (!isRecordValid(stored)) {
+    writeBytes(currentLayout.recordOffset(index), record, RECORD_LENGTH);
+    return true;
   }
+  return writeRecordChanges(index, record, stored);
+}
+
+bool writePresetChanges(Preset preset, Preset stored, byte index) {
+  byte record[RECORD_LENGTH];
+  byte storedRecord[RECORD_LENGTH];
+  presetToRecord(preset, record);
+  presetToRecord(stored, storedRecord);
+  return writeRecordChanges(index, record, storedRecord);
 }
 
+void writeMidiMapping() {
+  byte crc[2];
+  putWord(crc, crcOf(midiMap, PRESET_COUNT));
+  writeBytes(currentLayout.mapOffset(), midiMap, PRESET_COUNT);
+  writeBytes(MAP_CRC_OFFSET, crc, 2);
+}
+
+void readPresetData(byte index) {
+  byte record[PRESET_LENGTH];
+  readBytes(currentLayout.recordOffset(index), record, PRESET_LENGTH);
+  recordToPreset(record, currentPreset);
+}
+
+void readMidiMap() {
+  readBytes(currentLayout.mapOffset(), midiMap, PRESET_COUNT);
+}
+
+// The state crc sits right in front of the state, both go out in one write.
 void writeLastUsedPresetIndex(byte index) {
-  // offset = signature + presets + midi map
-  int offset = SIGNATURE_LENGTH + PRESET_LENGTH * PRESET_COUNT + PRESET_COUNT;
-  #ifdef EMULATE_EEPROM
-  memory[offset] = index;
-  #else 
-  eeprom.write8(offset, index);
-  #endif
+  byte state[2 + STATE_LENGTH];
+  putWord(state, crcOf(&index, STATE_LENGTH));
+  state[2] = index;
+  writeBytes(STATE_CRC_OFFSET, state, 2 + STATE_LENGTH);
 }
 
 byte readLastUsedPresetIndex() {
-  // offset = signature + presets + midi map
-  int offset = SIGNATURE_LENGTH + PRESET_LENGTH * PRESET_COUNT + PRESET_COUNT;
-  #ifdef EMULATE_EEPROM
-  return memory[offset];
-  #else
-  return eeprom.read8(offset);
-  #endif
+  byte index = readByte(STATE_OFFSET);
+  return index < PRESET_COUNT ? index : 0;
 }
 
 void setupProgramPins() {
@@ -157,7 +619,6 @@ byte remapValue(byte value) {
 
 void writeParam1Pin(byte value) {
   byte mappedValue = remapValue(value);
-  Serial.println(mappedValue);
   OCR1A = mappedValue;
 }
 
@@ -170,3 +631,15 @@ void writeParam3Pin(byte value) {
   byte mappedValue = remapValue(value);
   OCR2A = mappedValue;
 }
+
+byte readParam1Pin() {
+  return OCR1A;
+}
+
+byte readParam2Pin() {
+  return OCR1B;
+}
+
+byte readParam3Pin() {
+  return OCR2A;
+}
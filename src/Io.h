@@ -5,8 +5,12 @@
 #include "ApplicationModel.h"
 
 #define SIGNATURE_LENGTH 3
-#define PRESET_LENGTH 4
+#define LAYOUT_VERSION 4
+#define HEADER_LENGTH 15
+#define PRESET_LENGTH 9
+#define RECORD_LENGTH (PRESET_LENGTH + 2)
 #define PRESET_COUNT 32
+#define STATE_LENGTH 1
 
 #define S0_PIN 4
 #define S1_PIN 5
@@ -17,10 +21,37 @@
 #define POT1_PIN 10
 #define POT2_PIN 11
 
+// Memory layout (version 4):
+// [0..2]   signature 'MFX'
+// [3]      layout version
+// [4..6]   preset length, preset count, midi map length
+// [7..8]   crc of bytes 0..6
+// [9..10]  crc of the midi map
+// [11..12] crc of the last used preset index
+// [13]     last used preset index
+// [14]     unused, keeps the presets where older layouts had them
+// [15..]   presets, each followed by its own crc, then the midi map
+// Version 1 had the bare signature followed directly by presets, midi map
+// and last used index. Version 2 and 3 added a header with one crc per
+// section, version 3 added the lfo settings to the presets.
+
+enum MemoryCheckResult {
+  MC_OK,
+  MC_FACTORY_RESET,
+  MC_MIGRATED,
+  MC_REPAIRED
+};
+
 bool isMemoryInitialized();
+MemoryCheckResult checkMemory();
 void factoryReset();
-void writePresetData(Preset preset, byte index);
+// Both return false if the stored preset was already up to date.
+bool writePresetData(Preset preset, byte index);
+// Compares against a copy of the stored preset instead of reading it back.
+bool writePresetChanges(Preset preset, Preset stored, byte index);
 void writeMidiMapping();
+// True while queued writes have not reached the eeprom yet.
+bool isWritingMemory();
 
 void readPresetData(byte index);
 void readMidiMap();
@@ -29,6 +60,9 @@ void setupPWNPins();
 void writeParam1Pin(byte value);
 void writeParam2Pin(byte value);
 void writeParam3Pin(byte value);
+byte readParam1Pin();
+byte readParam2Pin();
+byte readParam3Pin();
 
 void setupProgramPins();
 void writeProgramPins(byte program);
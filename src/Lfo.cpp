@@ -0,0 +1,174 @@
+#include "Lfo.h"
+#include <avr/pgmspace.h>
+#include "MidiInput.h"
+
+// Phase increment per tick for rate 0, the fastest rate is about 15 Hz.
+#define LFO_RATE_STEP 4
+#define CLOCKS_PER_BEAT 24
+#define RANDOM_SEED 0xACE1
+
+// One signed sine cycle, indexed by the high byte of the phase.
+const int8_t sineTable[256] PROGMEM = {
+  0, 3, 6, 9, 12, 16, 19, 22, 25, 28, 31, 34, 37, 40, 43, 46,
+  49, 51, 54, 57, 60, 63, 65, 68, 71, 73, 76, 78, 81, 83, 85, 88,
+  90, 92, 94, 96, 98, 100, 102, 104, 106, 107, 109, 111, 112, 113, 115, 116,
+  117, 118, 120, 121, 122, 122, 123, 124, 125, 125, 126, 126, 126, 127, 127, 127,
+  127, 127, 127, 127, 126, 126, 126, 125, 125, 124, 123, 122, 122, 121, 120, 118,
+  117, 116, 115, 113, 112, 111, 109, 107, 106, 104, 102, 100, 98, 96, 94, 92,
+  90, 88, 85, 83, 81, 78, 76, 73, 71, 68, 65, 63, 60, 57, 54, 51,
+  49, 46, 43, 40, 37, 34, 31, 28, 25, 22, 19, 16, 12, 9, 6, 3,
+  0, -3, -6, -9, -12, -16, -19, -22, -25, -28, -31, -34, -37, -40, -43, -46,
+  -49, -51, -54, -57, -60, -63, -65, -68, -71, -73, -76, -78, -81, -83, -85, -88,
+  -90, -92, -94, -96, -98, -100, -102, -104, -106, -107, -109, -111, -112, -113, -115, -116,
+  -117, -118, -120, -121, -122, -122, -123, -124, -125, -125, -126, -126, -126, -127, -127, -127,
+  -127, -127, -127, -127, -126, -126, -126, -125, -125, -124, -123, -122, -122, -121, -120, -118,
+  -117, -116, -115, -113, -112, -111, -109, -107, -106, -104, -102, -100, -98, -96, -94, -92,
+  -90, -88, -85, -83, -81, -78, -76, -73, -71, -68, -65, -63, -60, -57, -54, -51,
+  -49, -46, -43, -40, -37, -34, -31, -28, -25, -22, -19, -16, -12, -9, -6, -3
+};
+
+volatile bool lfoRunning = false;
+volatile bool lfoClockSynced = false;
+volatile byte lfoTarget = LT_NONE;
+volatile byte lfoShape = LS_SINE;
+volatile byte lfoDepth = 0;
+volatile byte lfoBase = 0;
+volatile uint16_t lfoPhase = 0;
+volatile uint16_t lfoIncrement = LFO_RATE_STEP;
+uint16_t lfoClockIncrement = 0;
+
+uint16_t randomState = RANDOM_SEED;
+int8_t randomFrom = 0;
+int8_t randomTo = 0;
+
+int8_t nextRandom() {
+  randomState ^= randomState << 7;
+  randomState ^= randomState >> 9;
+  randomState ^= randomState << 8;
+  return (int8_t)(randomState >> 8);
+}
+
+int8_t waveValue(byte index) {
+  switch (lfoShape) {
+    case LS_SINE:
+      return (int8_t)pgm_read_byte(&sineTable[index]);
+    case LS_TRIANGLE:
+      return index < 128 ? index * 2 - 127 : 383 - index * 2;
+    case LS_SQUARE:
+      return index < 128 ? 127 : -127;
+    case LS_RANDOM:
+      // glides to the next random value over one cycle
+      return randomFrom + (((randomTo - randomFrom) * (index >> 1)) >> 7);
+    default:
+      return randomTo;
+  }
+}
+
+void writeLfoOutput(byte value) {
+  switch (lfoTarget) {
+    case LT_PARAM1: OCR1A = value; break;
+    case LT_PARAM2: OCR1B = value; break;
+    case LT_PARAM3: OCR2A = value; break;
+  }
+}
+
+// Fixed cost: one table read, one 8x8 bit multiply and a register write.
+void advanceLfo(uint16_t increment) {
+  uint16_t phase = lfoPhase + increment;
+  if (phase < lfoPhase) {
+    randomFrom = randomTo;
+    randomTo = nextRandom();
+  }
+  lfoPhase = phase;
+
+  int value = lfoBase + ((waveValue(phase >> 8) * lfoDepth) >> 7);
+  writeLfoOutput(constrain(value, 0, 255));
+}
+
+ISR(TIMER0_COMPA_vect) {
+  if (lfoRunning && !lfoClockSynced) {
+    advanceLfo(lfoIncrement);
+  }
+}
+
+void setupLfo() {
+  // timer 0 keeps running for millis(), the compare match adds a second interrupt per overflow
+  OCR0A = 0x80;
+  TIMSK0 |= _BV(OCIE0A);
+}
+
+byte paramValue(Preset &preset, byte target) {
+  switch (target) {
+    case LT_PARAM1: return preset.param1;
+    case LT_PARAM2: return preset.param2;
+    default: return preset.param3;
+  }
+}
+
+bool isLfoActive(Preset &preset) {
+  return preset.lfoTarget != LT_NONE && preset.lfoTarget <= LT_PARAM3 && preset.lfoDepth != 0;
+}
+
+// Only called with the lfo stopped or interrupts off, the isr reads all of these.
+void applyLfoSettings(Preset &preset) {
+  lfoTarget = preset.lfoTarget;
+  lfoShape = preset.lfoShape;
+  lfoDepth = preset.lfoDepth;
+  lfoBase = paramValue(preset, preset.lfoTarget);
+  lfoIncrement = (preset.lfoRate + 1) * LFO_RATE_STEP;
+  lfoClockSynced = preset.lfoSync == LY_MIDI_CLOCK;
+  lfoClockIncrement = 65536UL / (CLOCKS_PER_BEAT * ((preset.lfoRate >> 5) + 1));
+  acceptMidiClock = lfoClockSynced;
+}
+
+void startLfo(Preset preset) {
+  bool wasRunning = lfoRunning;
+  stopLfo();
+  if (wasRunning) {
+    // hand the old target its plain value, it might not be modulated anymore
+    writeLfoOutput(lfoBase);
+  }
+  acceptMidiClock = false;
+  if (!isLfoActive(preset)) {
+    return;
+  }
+
+  applyLfoSettings(preset);
+  if (preset.lfoSync != LY_FREE) {
+    lfoPhase = 0;
+  }
+  lfoRunning = true;
+}
+
+void updateLfo(Preset preset) {
+  bool active = isLfoActive(preset);
+  if (lfoRunning && (!active || preset.lfoTarget != lfoTarget)) {
+    stopLfo();
+    writeLfoOutput(lfoBase);
+  }
+  if (!active) {
+    acceptMidiClock = false;
+    return;
+  }
+
+  noInterrupts();
+  applyLfoSettings(preset);
+  lfoRunning = true;
+  interrupts();
+}
+
+void stopLfo() {
+  lfoRunning = false;
+}
+
+void updateLfoBase(byte target, byte value) {
+  if (lfoTarget == target) {
+    lfoBase = value;
+  }
+}
+
+void onLfoClock() {
+  if (lfoRunning && lfoClockSynced) {
+    advanceLfo(lfoClockIncrement);
+  }
+}
@@ -0,0 +1,51 @@
+#ifndef LFO_H
+#define LFO_H
+
+#include <Arduino.h>
+#include "ApplicationModel.h"
+
+#define LFO_TARGET_CONTROLLER 24
+#define LFO_SHAPE_CONTROLLER 25
+#define LFO_RATE_CONTROLLER 26
+#define LFO_DEPTH_CONTROLLER 27
+#define LFO_SYNC_CONTROLLER 28
+
+enum LfoTarget {
+  LT_NONE = 0,
+  LT_PARAM1 = 1,
+  LT_PARAM2 = 2,
+  LT_PARAM3 = 3
+};
+
+enum LfoShape {
+  LS_SINE,
+  LS_TRIANGLE,
+  LS_SQUARE,
+  LS_RANDOM,
+  LS_SAMPLE_AND_HOLD
+};
+
+enum LfoSync {
+  LY_FREE,          // keeps its phase across preset changes
+  LY_RETRIGGER,     // restarts with every preset load
+  LY_MIDI_CLOCK     // one cycle every 1 to 8 beats of the midi clock
+};
+
+// Hooks the lfo on the timer 0 compare interrupt, which ticks at about 976 Hz.
+void setupLfo();
+
+// Modulates the preset's target pot around its stored value.
+// Restarts the phase unless the lfo runs free.
+void startLfo(Preset preset);
+void stopLfo();
+
+// Takes over changed settings on the running lfo, the phase goes on where it is.
+void updateLfo(Preset preset);
+
+// Moves the center of the modulation after an edit of the target parameter.
+void updateLfoBase(byte target, byte value);
+
+// Advances a clock synced lfo, call for every midi clock.
+void onLfoClock();
+
+#endif
@@ -0,0 +1,76 @@
+#include "MidiFeedback.h"
+#include "MidiInput.h"
+
+#define CONTROLLER_COUNT 4
+#define PROGRAM_SLOT CONTROLLER_COUNT
+
+struct FeedbackSlot {
+  bool pending;
+  byte value;
+};
+
+const byte controllers[CONTROLLER_COUNT] = {
+  PARAM1_CONTROLLER,
+  PARAM2_CONTROLLER,
+  PARAM3_CONTROLLER,
+  PROGRAM_CONTROLLER
+};
+
+// one slot per controller plus one for program changes
+FeedbackSlot feedbackSlots[CONTROLLER_COUNT + 1];
+byte nextFeedbackSlot = 0;
+
+unsigned int midiFeedbackInterval = DEFAULT_FEEDBACK_INTERVAL;
+unsigned long lastFeedbackTime = 0;
+
+ControlChangeSender sendControlChange = NULL;
+ProgramChangeSender sendProgramChange = NULL;
+
+void setupMidiFeedback(ControlChangeSender controlChangeSender, ProgramChangeSender programChangeSender) {
+  sendControlChange = controlChangeSender;
+  sendProgramChange = programChangeSender;
+}
+
+void queueControlChange(byte controller, byte value) {
+  for (byte i = 0; i < CONTROLLER_COUNT; i++) {
+    if (controllers[i] == controller) {
+      feedbackSlots[i].pending = true;
+      feedbackSlots[i].value = value & 0x7F;
+      return;
+    }
+  }
+}
+
+void queueProgramChange(byte program) {
+  feedbackSlots[PROGRAM_SLOT].pending = true;
+  feedbackSlots[PROGRAM_SLOT].value = program & 0x7F;
+}
+
+void serviceMidiFeedback() {
+  if (sendControlChange == NULL || millis() - lastFeedbackTime < midiFeedbackInterval) {
+    return;
+  }
+  // incoming messages go first
+  if (midiInput.available() > 0) {
+    return;
+  }
+
+  // round robin, so a sweep on one controller can't starve the others
+  for (byte i = 0; i <= CONTROLLER_COUNT; i++) {
+    byte slot = (nextFeedbackSlot + i) % (CONTROLLER_COUNT + 1);
+    if (!feedbackSlots[slot].pending) {
+      continue;
+    }
+
+    feedbackSlots[slot].pending = false;
+    if (slot == PROGRAM_SLOT) {
+      sendProgramChange(feedbackSlots[slot].value);
+    } else {
+      sendControlChange(controllers[slot], feedbackSlots[slot].value);
+    }
+
+    nextFeedbackSlot = (slot + 1) % (CONTROLLER_COUNT + 1);
+    lastFeedbackTime = millis();
+    return;
+  }
+}
@@ -0,0 +1,28 @@
+#ifndef MIDI_FEEDBACK_H
+#define MIDI_FEEDBACK_H
+
+#include <Arduino.h>
+
+#define PARAM1_CONTROLLER 20
+#define PARAM2_CONTROLLER 21
+#define PARAM3_CONTROLLER 22
+#define PROGRAM_CONTROLLER 23
+
+#define DEFAULT_FEEDBACK_INTERVAL 10
+
+typedef void (*ControlChangeSender)(byte controller, byte value);
+typedef void (*ProgramChangeSender)(byte program);
+
+// Minimum time in ms between two sent messages.
+extern unsigned int midiFeedbackInterval;
+
+void setupMidiFeedback(ControlChangeSender controlChangeSender, ProgramChangeSender programChangeSender);
+
+// Only the latest value per controller is kept until it is sent.
+void queueControlChange(byte controller, byte value);
+void queueProgramChange(byte program);
+
+// Sends at most one pending message once the interval passed.
+void serviceMidiFeedback();
+
+#endif
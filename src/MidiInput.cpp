@@ -0,0 +1,89 @@
+#include "MidiInput.h"
+
+#define MIDI_BUFFER_MASK (MIDI_BUFFER_LENGTH - 1)
+
+#define MIDI_CLOCK 0xF8
+#define MIDI_START 0xFA
+#define MIDI_CONTINUE 0xFB
+#define MIDI_STOP 0xFC
+#define MIDI_ACTIVE_SENSING 0xFE
+#define MIDI_SYSTEM 0xF0
+#define MIDI_STATUS 0x80
+
+MidiInputBuffer midiInput;
+MidiInputStats midiInputStats;
+bool acceptMidiClock = false;
+byte midiInputChannel = DEFAULT_MIDI_INPUT_CHANNEL;
+
+bool isFilteredRealtime(byte value) {
+  switch (value) {
+    case MIDI_ACTIVE_SENSING:
+      return true;
+    case MIDI_CLOCK:
+    case MIDI_START:
+    case MIDI_CONTINUE:
+    case MIDI_STOP:
+      return !acceptMidiClock;
+    default:
+      return false;
+  }
+}
+
+void MidiInputBuffer::begin(unsigned long baudrate) {
+  Serial.begin(baudrate);
+}
+
+void MidiInputBuffer::poll() {
+  int pending = Serial.available();
+  // the hardware buffer holds one byte less than its size, full means we likely lost some
+  if (pending >= SERIAL_RX_BUFFER_SIZE - 1) {
+    midiInputStats.hardwareOverruns++;
+  }
+
+  while (pending-- > 0) {
+    byte value = Serial.read();
+    if (isFilteredRealtime(value)) {
+      midiInputStats.filtered++;
+      continue;
+    }
+
+    // realtime bytes may sit inside a message and leave the running status alone
+    if (value >= MIDI_STATUS && value < MIDI_CLOCK) {
+      droppingData = value < MIDI_SYSTEM
+        && midiInputChannel != 0
+        && (value & 0x0F) != midiInputChannel - 1;
+      if (droppingData) {
+        midiInputStats.filtered++;
+        continue;
+      }
+    } else if (value < MIDI_STATUS && droppingData) {
+      continue;
+    }
+
+    byte next = (head + 1) & MIDI_BUFFER_MASK;
+    if (next == tail) {
+      midiInputStats.bufferOverruns++;
+      continue;
+    }
+    buffer[head] = value;
+    head = next;
+  }
+}
+
+int MidiInputBuffer::available() {
+  poll();
+  return (head - tail) & MIDI_BUFFER_MASK;
+}
+
+byte MidiInputBuffer::read() {
+  if (head == tail) {
+    return 0;
+  }
+  byte value = buffer[tail];
+  tail = (tail + 1) & MIDI_BUFFER_MASK;
+  return value;
+}
+
+size_t MidiInputBuffer::write(byte value) {
+  return Serial.write(value);
+}
@@ -0,0 +1,44 @@
+#ifndef MIDI_INPUT_H
+#define MIDI_INPUT_H
+
+#include <Arduino.h>
+
+// Must be a power of two.
+#define MIDI_BUFFER_LENGTH 128
+#define DEFAULT_MIDI_INPUT_CHANNEL 0
+
+struct MidiInputStats {
+  unsigned int hardwareOverruns;
+  unsigned int bufferOverruns;
+  unsigned int filtered;
+  unsigned int coalesced;
+};
+
+// Serial port used as the MIDI transport. Moves everything the UART received
+// into a larger buffer and drops realtime bytes nobody listens to, as well as
+// channel messages for other channels.
+class MidiInputBuffer {
+public:
+  void begin(unsigned long baudrate);
+  int available();
+  byte read();
+  size_t write(byte value);
+
+  // Drains the hardware receive buffer. Cheap enough to call from any wait.
+  void poll();
+
+private:
+  byte buffer[MIDI_BUFFER_LENGTH];
+  byte head = 0;
+  byte tail = 0;
+  // data bytes follow the last status byte, even without repeating it
+  bool droppingData = false;
+};
+
+extern MidiInputBuffer midiInput;
+extern MidiInputStats midiInputStats;
+extern bool acceptMidiClock;
+// 1 to 16, 0 listens to all channels.
+extern byte midiInputChannel;
+
+#endif
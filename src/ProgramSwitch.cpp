@@ -0,0 +1,195 @@
+#include "ProgramSwitch.h"
+#include <IoAbstraction.h>
+#include "Io.h"
+#include "Lfo.h"
+
+#define SWITCH_STEP_TIME 1
+
+enum SwitchPhase {
+  SP_IDLE,
+  SP_RAMP_DOWN,
+  SP_LOADING,
+  SP_RAMP_UP
+};
+
+ProgramTiming programTimings[PROGRAM_COUNT] = {
+  {DEFAULT_RAMP_TIME, DEFAULT_LOAD_TIME},
+  {DEFAULT_RAMP_TIME, DEFAULT_LOAD_TIME},
+  {DEFAULT_RAMP_TIME, DEFAULT_LOAD_TIME},
+  {DEFAULT_RAMP_TIME, DEFAULT_LOAD_TIME},
+  {DEFAULT_RAMP_TIME, DEFAULT_LOAD_TIME},
+  {DEFAULT_RAMP_TIME, DEFAULT_LOAD_TIME},
+  {DEFAULT_RAMP_TIME, DEFAULT_LOAD_TIME},
+  {DEFAULT_RAMP_TIME, DEFAULT_LOAD_TIME}
+};
+
+SwitchPhase switchPhase = SP_IDLE;
+taskid_t switchTaskId = TASKMGR_INVALIDID;
+unsigned long phaseStartTime = 0;
+
+byte activeProgram = 0;
+Preset targetPreset;
+byte potValues[3];
+byte rampStartValues[3];
+byte rampEndValues[3];
+
+void writePotValues() {
+  writeParam1Pin(potValues[0]);
+  writeParam2Pin(potValues[1]);
+  writeParam3Pin(potValues[2]);
+}
+
+void startPhase(SwitchPhase phase) {
+  switchPhase = phase;
+  phaseStartTime = millis();
+  memcpy(rampStartValues, potValues, 3);
+
+  if (phase == SP_RAMP_DOWN) {
+    memset(rampEndValues, SAFE_POT_VALUE, 3);
+  } else if (phase == SP_RAMP_UP) {
+    rampEndValues[0] = targetPreset.param1;
+    rampEndValues[1] = targetPreset.param2;
+    rampEndValues[2] = targetPreset.param3;
+  }
+}
+
+// Returns true once the ramp reached its end values.
+bool rampPots(byte rampTime) {
+  unsigned long elapsed = millis() - phaseStartTime;
+  if (elapsed >= rampTime) {
+    memcpy(potValues, rampEndValues, 3);
+    writePotValues();
+    return true;
+  }
+
+  for (byte i = 0; i < 3; i++) {
+    int delta = (int)rampEndValues[i] - rampStartValues[i];
+    potValues[i] = rampStartValues[i] + (long)delta * elapsed / rampTime;
+  }
+  writePotValues();
+  return false;
+}
+
+void stopSwitchTask() {
+  switchPhase = SP_IDLE;
+  if (switchTaskId != TASKMGR_INVALIDID) {
+    taskManager.cancelTask(switchTaskId);
+    switchTaskId = TASKMGR_INVALIDID;
+  }
+}
+
+void onSwitchStep() {
+  // the ramp down mutes the program that is still playing, the rest belongs to the new one
+  ProgramTiming &timing = programTimings[targetPreset.program];
+
+  switch (switchPhase) {
+    case SP_RAMP_DOWN:
+      if (rampPots(programTimings[activeProgram].rampTime)) {
+        activeProgram = targetPreset.program;
+        writeProgramPins(activeProgram);
+        startPhase(SP_LOADING);
+      }
+      break;
+    case SP_LOADING:
+      if (millis() - phaseStartTime >= timing.loadTime) {
+        startPhase(SP_RAMP_UP);
+      }
+      break;
+    case SP_RAMP_UP:
+      if (rampPots(timing.rampTime)) {
+        stopSwitchTask();
+        startLfo(targetPreset);
+      }
+      break;
+    default:
+      stopSwitchTask();
+      break;
+  }
+}
+
+void applyPresetImmediately(Preset preset) {
+  stopSwitchTask();
+  targetPreset = preset;
+  activeProgram = preset.program;
+  potValues[0] = preset.param1;
+  potValues[1] = preset.param2;
+  potValues[2] = preset.param3;
+  writeProgramPins(activeProgram);
+  writePotValues();
+  startLfo(preset);
+}
+
+void switchToPreset(Preset preset) {
+  preset.program %= PROGRAM_COUNT;
+  targetPreset = preset;
+
+  // ramp from wherever the lfo left its target
+  stopLfo();
+  potValues[0] = readParam1Pin();
+  potValues[1] = readParam2Pin();
+  potValues[2] = readParam3Pin();
+
+  if (preset.program != activeProgram) {
+    if (switchPhase == SP_LOADING) {
+      // the pots are still muted, so the program can change right away
+      activeProgram = preset.program;
+      writeProgramPins(activeProgram);
+      startPhase(SP_LOADING);
+    } else if (switchPhase != SP_RAMP_DOWN) {
+      startPhase(SP_RAMP_DOWN);
+    }
+  } else if (switchPhase != SP_LOADING) {
+    // same program, no need to mute
+    startPhase(SP_RAMP_UP);
+  }
+
+  if (switchTaskId == TASKMGR_INVALIDID) {
+    switchTaskId = taskManager.scheduleFixedRate(SWITCH_STEP_TIME, onSwitchStep);
+  }
+}
+
+void writePot(byte pot, byte value) {
+  switch (pot) {
+    case 0: targetPreset.param1 = value; break;
+    case 1: targetPreset.param2 = value; break;
+    default: targetPreset.param3 = value; break;
+  }
+
+  if (switchPhase == SP_RAMP_UP) {
+    rampEndValues[pot] = value;
+  }
+  if (switchPhase != SP_IDLE) {
+    // muted or ramping, the ramp up takes the new value from the target
+    return;
+  }
+
+  potValues[pot] = value;
+  switch (pot) {
+    case 0: writeParam1Pin(value); break;
+    case 1: writeParam2Pin(value); break;
+    default: writeParam3Pin(value); break;
+  }
+}
+
+void writeLfoSettings(Preset preset) {
+  targetPreset.lfoTarget = preset.lfoTarget;
+  targetPreset.lfoShape = preset.lfoShape;
+  targetPreset.lfoRate = preset.lfoRate;
+  targetPreset.lfoDepth = preset.lfoDepth;
+  targetPreset.lfoSync = preset.lfoSync;
+
+  if (switchPhase == SP_IDLE) {
+    updateLfo(targetPreset);
+  }
+}
+
+void setProgramTiming(byte program, byte rampTime, byte loadTime) {
+  if (program < PROGRAM_COUNT) {
+    programTimings[program].rampTime = rampTime;
+    programTimings[program].loadTime = loadTime;
+  }
+}
+
+bool isSwitchingProgram() {
+  return switchPhase != SP_IDLE;
+}
@@ -0,0 +1,40 @@
+#ifndef PROGRAM_SWITCH_H
+#define PROGRAM_SWITCH_H
+
+#include <Arduino.h>
+#include "ApplicationModel.h"
+
+#define PROGRAM_COUNT 8
+#define DEFAULT_RAMP_TIME 8
+#define DEFAULT_LOAD_TIME 40
+#define SAFE_POT_VALUE 0
+
+// Time in ms to ramp the pots to and from the safe value
+// and to wait for the FV-1 to load a program.
+struct ProgramTiming {
+  byte rampTime;
+  byte loadTime;
+};
+
+// Sets the outputs without any ramping. Used at boot where the FV-1 is loading anyway.
+void applyPresetImmediately(Preset preset);
+
+// Moves the outputs to the given preset without stalling the loop.
+// A program change mutes the pots while the FV-1 reloads.
+void switchToPreset(Preset preset);
+
+// Sets one pot (0 to 2) of the current preset. Edits have to come through here,
+// so a running switch ends on them and the next ramp starts where the pot is.
+void writePot(byte pot, byte value);
+
+// Takes over the lfo settings of the current preset. A running switch starts
+// the lfo with them once it is done.
+void writeLfoSettings(Preset preset);
+
+// Nothing calls this yet. Until a setting uses it, all programs run with the
+// defaults from the table in ProgramSwitch.cpp.
+void setProgramTiming(byte program, byte rampTime, byte loadTime);
+
+bool isSwitchingProgram();
+
+#endif
@@ -9,13 +9,23 @@
 #include "ApplicationModel.h"
 #include "DisplayHelpers.h"
 #include "Io.h"
+#include "I2cBus.h"
+#include "MidiInput.h"
+#include "MidiFeedback.h"
+#include "Lfo.h"
+#include "EditHistory.h"
+#include "Autosave.h"
+#include "ProgramSwitch.h"
 
 #define MAX_PRESET_ENCODER_VALUE 31
 #define MAX_PARAMETER_ENCODER_VALUE 255
 #define MAX_PROGRAM_ENCODER_VALUE 7
+#define HISTORY_ENCODER_CENTER 128
 #define DONE_DISPLAY_TIME 300
+#define MIDI_FEEDBACK_CHANNEL 1
+#define NO_MIDI_PROGRAM 0xFF
 
-MIDI_CREATE_DEFAULT_INSTANCE();
+MIDI_CREATE_INSTANCE(MidiInputBuffer, midiInput, MIDI);
 
 // Button states  HIGH means NOT pressed down.
 int param1ButtonState = HIGH;
@@ -60,6 +70,7 @@ enum Event {
   turnParam1,
   turnParam2,
   turnParam3,
+  turnParam2WithParam1Pressed,
   pressPreset,
   pressParam1,
   longPressPreset,
@@ -98,6 +109,7 @@ void resetEditedMidiMapping();
 void updateMidiFromParameter();
 void updateMidiToParameter();
 void openPresetFromMidi();
+void stepHistory();
 
 struct Transition transitions[] = {
     // branching from start
@@ -109,6 +121,7 @@ struct Transition transitions[] = {
     {start, longPressPresetWithParam1Pressed, editMidiMapping, transitionToEditMidiMapping},
     {start, turnPresetWithParam1Pressed, editProgram, transitionToEditProgram},
     {start, midiProgramCommand, processMidiData,  openPresetFromMidi},
+    {start, turnParam2WithParam1Pressed, start, stepHistory},
 
     // branching from selectPresetToOpen
     {selectPresetToOpen, turnPreset, selectPresetToOpen, updatePresetToOpen},
@@ -147,6 +160,7 @@ struct Transition transitions[] = {
     {editMidiMapping, turnPreset, editMidiMapping, updateMidiToParameter},
     {editMidiMapping, pressParam1, restoreMidiMapping, resetEditedMidiMapping},
     {editMidiMapping, longPressPreset, saveMidiMapping, saveEditedMidiMapping},
+    {editMidiMapping, turnParam2WithParam1Pressed, editMidiMapping, stepHistory},
 
     {restoreMidiMapping, operationFinished, start, transitionToStart},
     {saveMidiMapping, operationFinished, start, transitionToStart},
@@ -158,6 +172,16 @@ State currentState = start;
 bool muteEvents = false;
 bool presetTurnedWhileParam1Down = false;
 
+// Only the newest program change of one loop pass gets applied.
+bool midiProgramPending = false;
+byte pendingMidiProgram = 0;
+
+// Presets opened from MIDI are not reported back, the sender already knows.
+bool presetOpenedFromMidi = false;
+
+// Turning param 2 with param 1 held down steps through the edit history.
+bool historyForward = false;
+
 void handleEvent(Event event) {
   if (muteEvents) {
     return;
@@ -176,6 +200,7 @@ void handleEvent(Event event) {
 void updateParam1ButtonState() {
   int buttonState = digitalRead(PARAM1_BUTTON_PIN);
   if (buttonState != param1ButtonState) {
+    noteUserActivity();
     param1ButtonState = buttonState;
     // was LOW before therefore user just lifted it up
     if (param1ButtonState == HIGH) {
@@ -193,6 +218,7 @@ void updateParam1ButtonState() {
 void updatePresetButtonState() {
   int buttonState = digitalRead(PRESET_BUTTON_PIN);
   if (buttonState != presetButtonState) {
+    noteUserActivity();
     presetButtonState = buttonState;
     if (presetButtonState == HIGH) {
       if (!presetButtonLongPress) {
@@ -222,12 +248,55 @@ void updateButtonStates() {
 }
 
 void handleProgramChange(byte channel, byte number) {
-  receivedMidiProgrammIndex = number;
-  handleEvent(midiProgramCommand);
+  if (number >= PRESET_COUNT) {
+    midiInputStats.filtered++;
+    return;
+  }
+  if (midiProgramPending) {
+    midiInputStats.coalesced++;
+  }
+  pendingMidiProgram = number;
+  midiProgramPending = true;
+}
+
+void handleControlChange(byte channel, byte number, byte value) {
+  switch (number) {
+    case LFO_TARGET_CONTROLLER: currentPreset.lfoTarget = value; break;
+    case LFO_SHAPE_CONTROLLER: currentPreset.lfoShape = value; break;
+    case LFO_RATE_CONTROLLER: currentPreset.lfoRate = value << 1; break;
+    case LFO_DEPTH_CONTROLLER: currentPreset.lfoDepth = value << 1; break;
+    case LFO_SYNC_CONTROLLER: currentPreset.lfoSync = value; break;
+    default: return;
+  }
+  markPresetDirty();
+  writeLfoSettings(currentPreset);
+}
+
+// delay() that keeps parsing MIDI. Program changes stay pending until the next loop pass.
+void delayReadingMidi(unsigned long time) {
+  unsigned long startTime = millis();
+  while (millis() - startTime < time) {
+    while (midiInput.available() > 0) {
+      MIDI.read();
+    }
+  }
+}
+
+void readMidi() {
+  while (midiInput.available() > 0) {
+    MIDI.read();
+  }
+
+  if (midiProgramPending) {
+    midiProgramPending = false;
+    receivedMidiProgrammIndex = pendingMidiProgram;
+    handleEvent(midiProgramCommand);
+  }
 }
 
 // ------------------- Encoders -> Event
 void onPresetEncoderChange(int newValue) {
+  noteUserActivity();
   presetEncoderValue = newValue;
   if (param1ButtonState == HIGH) {
     handleEvent(turnPreset);
@@ -239,23 +308,44 @@ void onPresetEncoderChange(int newValue) {
 }
 
 void onParam1EncoderChange(int newValue) {
+  noteUserActivity();
   param1EncoderValue = newValue;
   handleEvent(turnParam1);
 }
 
+// The history gesture compares against the center, so the first turn already has a direction.
+void centerHistoryEncoder() {
+  muteEvents = true;
+  param2Encoder->changePrecision(MAX_PARAMETER_ENCODER_VALUE, HISTORY_ENCODER_CENTER);
+  muteEvents = false;
+  param2EncoderValue = HISTORY_ENCODER_CENTER;
+}
+
 void onParam2EncoderChange(int newValue) {
+  noteUserActivity();
+  // only start and the midi map editor know the history gesture
+  bool historyGesture = currentState == start || currentState == editMidiMapping;
+  if (param1ButtonState == LOW && historyGesture) {
+    presetTurnedWhileParam1Down = true;
+    historyForward = newValue > param2EncoderValue;
+    // recenter, so both directions keep working at the ends of the range
+    centerHistoryEncoder();
+    handleEvent(turnParam2WithParam1Pressed);
+    return;
+  }
   param2EncoderValue = newValue;
   handleEvent(turnParam2);
 }
 
 void onParam3EncoderChange(int newValue) {
+  noteUserActivity();
   param3EncoderValue = newValue;
   handleEvent(turnParam3);
 }
 
 // ------------------ Setup
 void setupEncoders() {
-  switches.initialiseInterrupt(ioFrom8754(0x20, 2), true);
+  switches.initialiseInterrupt(ioFrom8754(ENCODER_I2C_ADDRESS, 2), true);
   presetEncoder = new HardwareRotaryEncoder(0, 1, onPresetEncoderChange);
   param1Encoder = new HardwareRotaryEncoder(2, 3, onParam1EncoderChange);
   param2Encoder = new HardwareRotaryEncoder(4, 5, onParam2EncoderChange);
@@ -267,8 +357,7 @@ void setupEncoders() {
   switches.setEncoder(3, param3Encoder);
 
   muteEvents = true;
-  byte lastUsedPresetIndex = readLastUsedPresetIndex();
-  switches.changeEncoderPrecision(0, MAX_PRESET_ENCODER_VALUE, lastUsedPresetIndex);
+  switches.changeEncoderPrecision(0, MAX_PRESET_ENCODER_VALUE, currentPresetNumber);
   switches.changeEncoderPrecision(1, MAX_PARAMETER_ENCODER_VALUE, 0);
   switches.changeEncoderPrecision(2, MAX_PARAMETER_ENCODER_VALUE, 0);
   switches.changeEncoderPrecision(3, MAX_PARAMETER_ENCODER_VALUE, 0);
@@ -279,48 +368,102 @@ void setupButtons() {
   pinMode(PRESET_BUTTON_PIN, INPUT);
 }
 
+void createInitialPinState() {
+  applyPresetImmediately(currentPreset);
+}
+
+void restoreLastUsedPreset() {
+  currentPresetNumber = readLastUsedPresetIndex();
+  currentPreset.loadFrom(currentPresetNumber);
+  markPresetClean();
+}
+
 void setupSetupMemory() {
-   if (!isMemoryInitialized()) {
-    Serial.println("Nust clean");
-    factoryReset();
-  } else {
-    Serial.println("no clean today");
+  MemoryCheckResult result = checkMemory();
+  switch (result) {
+    case MC_FACTORY_RESET: Serial.println("Nust clean"); break;
+    case MC_MIGRATED: Serial.println("migrated"); break;
+    case MC_REPAIRED: Serial.println("repaired"); break;
+    default: Serial.println("no clean today"); break;
+  }
+
+  // the fast path might have read a preset that just got migrated or repaired
+  if (result != MC_OK) {
+    restoreLastUsedPreset();
+    switchToPreset(currentPreset);
   }
-  byte lastUsedPresetIndex = readLastUsedPresetIndex();
-  currentPreset.loadFrom(lastUsedPresetIndex);
 }
 
-void createInitialPinState() {
-  writeProgramPins(currentPreset.program);
-  writeParam1Pin(currentPreset.param1);
-  writeParam2Pin(currentPreset.param2);
-  writeParam3Pin(currentPreset.param3);
+void sendFeedbackControlChange(byte controller, byte value) {
+  MIDI.sendControlChange(controller, value, MIDI_FEEDBACK_CHANNEL);
+}
+
+void sendFeedbackProgramChange(byte program) {
+  MIDI.sendProgramChange(program, MIDI_FEEDBACK_CHANNEL);
+}
+
+// First midi program that maps to the preset, so a controller following us opens it again.
+// NO_MIDI_PROGRAM if the preset cannot be reached over midi.
+byte midiProgramForPreset(byte preset) {
+  for (byte i = 0; i < PRESET_COUNT; i++) {
+    if (midiMap[i] == preset) {
+      return i;
+    }
+  }
+  return NO_MIDI_PROGRAM;
 }
 
 void setupMidi() {
+  // channels are filtered in the input buffer already
   MIDI.begin(MIDI_CHANNEL_OMNI);
+  // thru would echo every input byte on the output, outside the feedback rate limit
+  MIDI.turnThruOff();
   MIDI.setHandleProgramChange(handleProgramChange);
+  MIDI.setHandleControlChange(handleControlChange);
+  MIDI.setHandleClock(onLfoClock);
+  setupMidiFeedback(sendFeedbackControlChange, sendFeedbackProgramChange);
 }
 
-void setup() {
-  Serial.begin(9600); // open the serial port at 9600 bps:
-  while (! Serial);
-  Wire.begin();
+// Drives the FV-1 with the last used preset as early as possible.
+// Only the header is validated here, the full check happens in the deferred path.
+unsigned long setupAudio() {
   setupProgramPins();
   setupPWNPins();
+  setupLfo();
+  setupI2c();
+  if (isMemoryInitialized()) {
+    restoreLastUsedPreset();
+  }
+  createInitialPinState();
+  return micros();
+}
+
+void setupDeferred(unsigned long audioReadyTime) {
+  Serial.begin(9600); // open the serial port at 9600 bps:
+  Serial.print("audio ready after us: ");
+  Serial.println(audioReadyTime);
   setupSetupMemory();
   setupDisplay();
   setupButtons();
   setupEncoders();
+  Serial.flush(); // MIDI reopens the port with its own baud rate
   setupMidi();
-  createInitialPinState();
+  setupAutosave();
   transitionToStart();
 }
 
+void setup() {
+  unsigned long audioReadyTime = setupAudio();
+  setupDeferred(audioReadyTime);
+}
+
 void loop() {
   updateButtonStates();
+  // encoder reads happen in here, so they go before any queued bus job
   taskManager.runLoop();
-  MIDI.read();
+  readMidi();
+  serviceMidiFeedback();
+  serviceI2c();
 }
 
 // -------------------- Event handler
@@ -338,10 +481,25 @@ void updatePresetToOpen() {
 }
 
 void openSelected() {
-  currentPresetNumber = presetEncoderValue;
-  currentPreset.loadFrom(currentPresetNumber);
-  createInitialPinState();
+  Preset editedPreset = currentPreset;
+  byte editedPresetNumber = currentPresetNumber;
+  // with autosave on, reopening the edited preset keeps the edits
+  if (!hasUnsavedEdits() || presetEncoderValue != currentPresetNumber) {
+    currentPresetNumber = presetEncoderValue;
+    currentPreset.loadFrom(currentPresetNumber);
+  }
+  switchToPreset(currentPreset);
+  // the load above must not wait for these writes
+  flushAutosave(editedPreset, editedPresetNumber);
+  markPresetClean();
   writeLastUsedPresetIndex(currentPresetNumber);
+  // the history refers to the preset that was open before
+  clearEditHistory();
+  byte midiProgram = midiProgramForPreset(currentPresetNumber);
+  if (!presetOpenedFromMidi && midiProgram != NO_MIDI_PROGRAM) {
+    queueProgramChange(midiProgram);
+  }
+  presetOpenedFromMidi = false;
   stopBlink();
   handleEvent(operationFinished);
 }
@@ -352,6 +510,7 @@ void transitionToStart() {
   muteEvents = true;
   presetEncoder->changePrecision(MAX_PRESET_ENCODER_VALUE, currentPresetNumber);
   muteEvents = false;
+  centerHistoryEncoder();
   drawNumber(currentPresetNumber + 1);
 }
 
@@ -370,6 +529,7 @@ void transitionToEditParam2() {
   muteEvents = true;
   param2Encoder->changePrecision(MAX_PARAMETER_ENCODER_VALUE, currentPreset.param2);
   muteEvents = false;
+  param2EncoderValue = currentPreset.param2;
   drawNumber(currentPreset.param2);
 }
 
@@ -382,24 +542,48 @@ void transitionToEditParam3() {
   drawNumber(currentPreset.param3);
 }
 
-void updateParam1() {
-  currentPreset.param1 = param1EncoderValue;
-  writeParam1Pin(currentPreset.param1);
+void applyParam1(byte value) {
+  currentPreset.param1 = value;
+  markPresetDirty();
+  writePot(0, currentPreset.param1);
+  updateLfoBase(LT_PARAM1, currentPreset.param1);
+  queueControlChange(PARAM1_CONTROLLER, currentPreset.param1 >> 1);
   drawNumber(currentPreset.param1);
 }
 
-void updateParam2() {
-  currentPreset.param2 = param2EncoderValue;
-  writeParam2Pin(currentPreset.param2);
+void updateParam1() {
+  recordEdit(EF_PARAM1, 0, currentPreset.param1, param1EncoderValue);
+  applyParam1(param1EncoderValue);
+}
+
+void applyParam2(byte value) {
+  currentPreset.param2 = value;
+  markPresetDirty();
+  writePot(1, currentPreset.param2);
+  updateLfoBase(LT_PARAM2, currentPreset.param2);
+  queueControlChange(PARAM2_CONTROLLER, currentPreset.param2 >> 1);
   drawNumber(currentPreset.param2);
 }
 
-void updateParam3() {
-  currentPreset.param3 = param3EncoderValue;
-  writeParam3Pin(currentPreset.param3);
+void updateParam2() {
+  recordEdit(EF_PARAM2, 0, currentPreset.param2, param2EncoderValue);
+  applyParam2(param2EncoderValue);
+}
+
+void applyParam3(byte value) {
+  currentPreset.param3 = value;
+  markPresetDirty();
+  writePot(2, currentPreset.param3);
+  updateLfoBase(LT_PARAM3, currentPreset.param3);
+  queueControlChange(PARAM3_CONTROLLER, currentPreset.param3 >> 1);
   drawNumber(currentPreset.param3);
 }
 
+void updateParam3() {
+  recordEdit(EF_PARAM3, 0, currentPreset.param3, param3EncoderValue);
+  applyParam3(param3EncoderValue);
+}
+
 void transitionToSavePreset() {
   dotIndex = DI_NONE;
   startBlink();
@@ -417,9 +601,10 @@ void updatePresetToSave() {
 void saveSelected() {
   currentPresetNumber = presetEncoderValue;
   currentPreset.saveTo(currentPresetNumber);
+  markPresetClean();
   stopBlink();
   showDone();
-  delay(DONE_DISPLAY_TIME);
+  delayReadingMidi(DONE_DISPLAY_TIME);
   handleEvent(operationFinished);
 }
 
@@ -432,12 +617,19 @@ void transitionToEditProgram() {
   drawNumber(currentPreset.program + 1);
 }
 
-void updateProgram() {
-  currentPreset.program = presetEncoderValue;
-  writeProgramPins(currentPreset.program);
+void applyProgram(byte value) {
+  currentPreset.program = value;
+  markPresetDirty();
+  switchToPreset(currentPreset);
+  queueControlChange(PROGRAM_CONTROLLER, currentPreset.program);
   drawNumber(currentPreset.program + 1);
 }
 
+void updateProgram() {
+  recordEdit(EF_PROGRAM, 0, currentPreset.program, presetEncoderValue);
+  applyProgram(presetEncoderValue);
+}
+
 void transitionToEditMidiMapping() {
   currentMidiMappingIndex = 1;
   dotIndex = DI_NONE;
@@ -445,22 +637,27 @@ void transitionToEditMidiMapping() {
   param1Encoder->changePrecision(MAX_PRESET_ENCODER_VALUE, currentMidiMappingIndex);
   presetEncoder->changePrecision(MAX_PRESET_ENCODER_VALUE, midiMap[currentMidiMappingIndex]);
   muteEvents = false;
+  centerHistoryEncoder();
   drawTwoBytes(currentMidiMappingIndex + 1, midiMap[currentMidiMappingIndex] + 1);
 }
 
 void saveEditedMidiMapping() {
   hideColon();
   saveMidiMap();
+  // undoing a map edit after this would leave the saved map behind
+  clearEditHistory();
   showDone();
-  delay(DONE_DISPLAY_TIME);
+  delayReadingMidi(DONE_DISPLAY_TIME);
   handleEvent(operationFinished);
 }
 
 void resetEditedMidiMapping() {
   hideColon();
   restoreMidiMap();
+  // the midi map records would undo into the restored map
+  clearEditHistory();
   showDone();
-  delay(DONE_DISPLAY_TIME);
+  delayReadingMidi(DONE_DISPLAY_TIME);
   handleEvent(operationFinished);
 }
 
@@ -473,13 +670,52 @@ void updateMidiFromParameter() {
 }
 
 void updateMidiToParameter() {
+  recordEdit(EF_MIDI_MAP, currentMidiMappingIndex, midiMap[currentMidiMappingIndex], presetEncoderValue);
   midiMap[currentMidiMappingIndex] = presetEncoderValue; 
   drawTwoBytes(currentMidiMappingIndex + 1, midiMap[currentMidiMappingIndex] + 1);
 }
 
 void openPresetFromMidi() {
+  presetOpenedFromMidi = true;
   muteEvents = true;
   presetEncoder->changePrecision(MAX_PRESET_ENCODER_VALUE, midiMap[receivedMidiProgrammIndex]);
   muteEvents = false;
   handleEvent(operationFinished);
 }
+
+void applyMidiMapping(byte index, byte value) {
+  midiMap[index] = value;
+  if (currentState != editMidiMapping) {
+    // only the editor shows the colon
+    hideColon();
+    drawNumber(currentPresetNumber + 1);
+    return;
+  }
+  currentMidiMappingIndex = index;
+  muteEvents = true;
+  param1Encoder->changePrecision(MAX_PRESET_ENCODER_VALUE, currentMidiMappingIndex);
+  presetEncoder->changePrecision(MAX_PRESET_ENCODER_VALUE, value);
+  muteEvents = false;
+  drawTwoBytes(index + 1, value + 1);
+}
+
+void applyEdit(EditRecord &record, byte value) {
+  switch (record.field) {
+    case EF_PARAM1: dotIndex = DI_FIRST; applyParam1(value); break;
+    case EF_PARAM2: dotIndex = DI_SECOND; applyParam2(value); break;
+    case EF_PARAM3: dotIndex = DI_THIRD; applyParam3(value); break;
+    case EF_PROGRAM: dotIndex = DI_FOURTH; applyProgram(value); break;
+    case EF_MIDI_MAP: dotIndex = DI_NONE; applyMidiMapping(record.index, value); break;
+  }
+}
+
+void stepHistory() {
+  EditRecord record;
+  if (historyForward) {
+    if (redoEdit(record)) {
+      applyEdit(record, record.newValue);
+    }
+  } else if (undoEdit(record)) {
+    applyEdit(record, record.oldValue);
+  }
+}